@@ -0,0 +1,363 @@
+#include "../src/include/canvas.h"
+#include "../src/include/cefile.h"
+#include "../src/include/centry.h"
+#include "../src/include/config.h"
+#include "../src/include/cursed.h"
+#include "../src/include/damage.h"
+#include "../src/include/layer.h"
+#include "../src/include/main.h"
+#include "../src/include/palette.h"
+
+#include <ncurses.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Benchmarks {{{
+ * Times the hot kernels on synthetic canvases of several sizes. Every kernel
+ * is repeated until it ran for at least BENCH_MIN_NS.
+ *
+ * Output is one CSV line per kernel and size (lines starting with '#' are
+ * comments):
+ *    kernel,height,width,cells,iterations,ns_per_cell,mb_per_s
+ * where MB/s counts `sizeof(struct CEntry)` bytes per cell.
+ *
+ * Screen kernels draw into a curses screen that writes to /dev/null, sized
+ * BENCH_SCREEN_LINES x BENCH_SCREEN_COLS.
+ * }}} */
+#define BENCH_MIN_NS (200 * 1000 * 1000)
+#define BENCH_SCREEN_LINES 60
+#define BENCH_SCREEN_COLS 400
+/* Layers composited by `layers_compose`, on canvases of up to
+ * BENCH_LAYERS_CELLS cells (every layer is fully allocated) */
+#define BENCH_LAYERS 8
+#define BENCH_LAYERS_CELLS (1 << 20)
+
+local const struct Vec2 SIZES[] = {
+    {.y = 24, .x = 80},
+    {.y = 64, .x = 256},
+    {.y = 1024, .x = 1024},
+    {.y = 4096, .x = 4096},
+};
+
+/* Everything the kernels work on */
+local struct {
+	int height, width;
+	struct Canvas *canvas, *other, *clip;
+	struct Layers layers;
+	struct CEntry *cells;
+	chtype *chtypes;
+	struct Palette palette;
+	char path[32];
+	int flip;
+} ctx;
+
+/* startfold Helpers */
+
+local u64 now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+local u32 xorshift(u32 *state) {
+	u32 x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+/* Random runs of 1 to 16 equal cells, like strokes in a drawing. With
+ * `holes`, every other run is transparent */
+local fn fill_synthetic(struct Canvas *canvas, u32 seed, bool holes) {
+	struct CEntry *row = malloc(sizeof(struct CEntry) * canvas->width);
+	foreach (y, 0, canvas->height) {
+		int x = 0;
+		while ( x < canvas->width ) {
+			u32 r = xorshift(&seed);
+			struct CEntry ce = {
+			    .ch = 33 + r % 94,
+			    .color_id = (r >> 8) % COLORS_LEN,
+			    .attrs = (r >> 16) % 8,
+			};
+			if ( holes && (r & (1 << 20)) ) {
+				ce = TRANSPARENT_CENTRY;
+			}
+			int end = min(x + 1 + (int)(r >> 24) % 16, canvas->width);
+			while ( x < end ) {
+				row[x++] = ce;
+			}
+		}
+		canvas_write_row(canvas, y, 0, canvas->width, row);
+	}
+	free(row);
+}
+
+/** startfold bench
+ * Time `kernel`, which processes `cells` cells per call, and print a result
+ * line
+ */
+local fn bench(const char *name, usize cells, fn (*kernel)()) {
+	kernel(); /* Warm up */
+
+	u64 iterations = 1;
+	u64 elapsed;
+	loop {
+		u64 start = now_ns();
+		for ( u64 i = 0; i < iterations; ++i ) {
+			kernel();
+		}
+		elapsed = now_ns() - start;
+		if ( elapsed >= BENCH_MIN_NS ) {
+			break;
+		}
+		iterations *= 2;
+	}
+
+	double total_cells = (double)cells * iterations;
+	printf("%s,%d,%d,%zu,%llu,%.3f,%.1f\n", name, ctx.height, ctx.width, cells,
+	       (unsigned long long)iterations, elapsed / total_cells,
+	       total_cells * sizeof(struct CEntry) / (elapsed / 1e9) / 1e6);
+	fflush(stdout);
+}
+
+/* endfold */
+
+/* endfold */
+
+/* startfold Kernels */
+
+/* Not aligned to tiles, so the edges are written cell by cell */
+local fn k_fill_rect() {
+	struct CEntry fill = {.ch = 'a' + ctx.flip, .color_id = ctx.flip};
+	canvas_fill_rect(ctx.canvas,
+	                 rect_from(1, 1, ctx.height - 2, ctx.width - 2), fill);
+	ctx.flip ^= 1;
+}
+
+local fn k_copy_area() {
+	copy_area(ctx.canvas, &ctx.clip, 0, 0, ctx.height - 1, ctx.width - 1);
+}
+
+local fn k_save() { cefile_save(ctx.canvas, NULL, NULL, ctx.path); }
+
+/* What an autosave costs the editor's thread, compared to `k_save` */
+local fn k_snapshot() {
+	canvas_snapshot_free(ctx.canvas, canvas_snapshot(ctx.canvas));
+}
+
+local fn k_load() {
+	cefile_load(ctx.path, rect_from(0, 0, ctx.height - 1, ctx.width - 1),
+	            ctx.other, NULL, NULL, 0, 0);
+}
+
+local fn k_compose() {
+	foreach (y, 0, ctx.height) {
+		layers_compose_row(&ctx.layers, y, 0, ctx.width,
+		                   ctx.cells + (usize)y * ctx.width);
+	}
+}
+
+/* What `render_row` does for curses: the pairs of the colors of a row are
+ * looked up once per frame, then every cell takes its attributes and pair
+ * from a table indexed by its attribute byte */
+local fn k_ce2curs() {
+	chtype styles[256];
+	u32 known = 0;
+	foreach (y, 0, ctx.height) {
+		const struct CEntry *cells = ctx.cells + (usize)y * ctx.width;
+		chtype *chtypes = ctx.chtypes + (usize)y * ctx.width;
+		u32 colors = 0;
+		foreach (x, 0, ctx.width) {
+			colors |= (u32)1 << cells[x].color_id;
+		}
+		foreach (id, 0, COLORS_LEN) {
+			if ( (colors & ~known) >> id & 1 ) {
+				chtype pair = COLOR_PAIR(palette_pair(&ctx.palette, id));
+				foreach (attrs, 0, 8) {
+					struct CEntry ce = {.color_id = id, .attrs = attrs};
+					styles[ce_attr_byte(ce)] = CE_ATTRS_LUT[attrs] | pair;
+				}
+			}
+		}
+		known |= colors;
+		foreach (x, 0, ctx.width) {
+			chtypes[x] = (u8)cells[x].ch | styles[ce_attr_byte(cells[x])];
+		}
+	}
+}
+
+local fn k_ce2curs_attrs() {
+	usize n = (usize)ctx.height * ctx.width;
+	for ( usize i = 0; i < n; ++i ) {
+		ctx.chtypes[i] = ce2curs_attrs(ctx.cells[i].attrs);
+	}
+}
+
+local fn k_clear_draw_area() {
+	clear_draw_area(ctx.canvas);
+	refresh();
+}
+
+/* Alternate between two images, so that every refresh has to repaint */
+local fn k_draw_buffer() {
+	draw_buffer(ctx.flip ? ctx.other : ctx.canvas);
+	ctx.flip ^= 1;
+}
+
+/* Full-view repaint into the curses buffer, without the terminal output */
+local fn k_flush_damage() {
+	damage_add(view_rect());
+	flush_damage(ctx.canvas);
+}
+
+/* Same, alternating between two images so that every cell is written */
+local fn k_flush_damage_flip() {
+	damage_add(view_rect());
+	flush_damage(ctx.flip ? ctx.other : ctx.canvas);
+	ctx.flip ^= 1;
+}
+
+local fn k_redraw_char() {
+	struct Rect view = view_rect();
+	foreach (y, view.y1, view.y2 + 1) {
+		foreach (x, view.x1, view.x2 + 1) {
+			redraw_char(ctx.canvas, y, x, false);
+		}
+	}
+}
+
+/* endfold */
+
+/** startfold bench_canvas
+ * Kernels that don't need a screen
+ */
+local fn bench_canvas(int height, int width) {
+	usize cells = (usize)height * width;
+	ctx.height = height;
+	ctx.width = width;
+	ctx.canvas = canvas_new(height, width);
+	ctx.other = canvas_new(height, width);
+	ctx.cells = malloc(sizeof(struct CEntry) * cells);
+	ctx.chtypes = malloc(sizeof(chtype) * cells);
+	if ( ctx.canvas == NULL || ctx.other == NULL || ctx.cells == NULL ||
+	     ctx.chtypes == NULL ) {
+		fprintf(stderr, "Out of memory for %dx%d\n", width, height);
+		exit(1);
+	}
+	fill_synthetic(ctx.canvas, 1, false);
+	foreach (y, 0, height) {
+		canvas_read_row(ctx.canvas, y, 0, width, ctx.cells + (usize)y * width);
+	}
+
+	bench("canvas_fill_rect", cells, k_fill_rect);
+	fill_synthetic(ctx.canvas, 1, false);
+	bench("copy_area", cells, k_copy_area);
+	bench("cefile_save", cells, k_save);
+	bench("canvas_snapshot", cells, k_snapshot);
+	bench("cefile_load", cells, k_load);
+	bench("ce2curs_styles", cells, k_ce2curs);
+	bench("ce2curs_attrs", cells, k_ce2curs_attrs);
+
+	if ( cells <= BENCH_LAYERS_CELLS ) {
+		struct Canvas *base = canvas_new(height, width);
+		fill_synthetic(base, 3, false);
+		layers_reset(&ctx.layers, base);
+		foreach (i, 1, BENCH_LAYERS) {
+			if ( layers_add(&ctx.layers, "bench") != ok ) {
+				fprintf(stderr, "Out of memory for %d layers\n", BENCH_LAYERS);
+				exit(1);
+			}
+			fill_synthetic(layers_active(&ctx.layers)->canvas, 3 + i, true);
+		}
+		bench("layers_compose", cells, k_compose);
+		layers_free(&ctx.layers);
+	}
+
+	canvas_free(ctx.canvas);
+	canvas_free(ctx.other);
+	canvas_free(ctx.clip);
+	ctx.clip = NULL;
+	free(ctx.cells);
+	free(ctx.chtypes);
+}
+
+/* endfold */
+
+/** startfold bench_screen
+ * Kernels that draw to the (null) screen
+ */
+local fn bench_screen() {
+	FILE *out = fopen("/dev/null", "w");
+	FILE *in = fopen("/dev/null", "r");
+	setenv("LINES", STRINGIFY(BENCH_SCREEN_LINES), 1);
+	setenv("COLUMNS", STRINGIFY(BENCH_SCREEN_COLS), 1);
+	SCREEN *screen = out && in ? newterm("xterm-256color", out, in) : NULL;
+	if ( screen == NULL ) {
+		printf("# No terminfo for xterm-256color, skipping screen kernels\n");
+		return;
+	}
+	start_color();
+	/* Like main, so that the repaints draw the palette's pairs */
+	pair_cache_init(COLORS_LEN, min(COLOR_PAIRS, PAIRS_MAX) - COLORS_LEN);
+	render_palette(&ctx.palette);
+
+	ctx.height = DRAW_AREA_HEIGHT;
+	ctx.width = DRAW_AREA_WIDTH;
+	usize cells = (usize)ctx.height * ctx.width;
+	ctx.canvas = canvas_new(ctx.height, ctx.width);
+	ctx.other = canvas_new(ctx.height, ctx.width);
+	fill_synthetic(ctx.other, 2, false);
+
+	bench("clear_draw_area", cells, k_clear_draw_area);
+	fill_synthetic(ctx.canvas, 1, false);
+	bench("draw_buffer", cells, k_draw_buffer);
+	bench("flush_damage", cells, k_flush_damage);
+	bench("flush_damage_flip", cells, k_flush_damage_flip);
+	bench("redraw_char", cells, k_redraw_char);
+
+	/* Same repaint, written by the ANSI writer instead of curses */
+	int null_fd = fileno(out);
+	struct Render *ansi = render_new(render_ansi, LINES, COLS, null_fd);
+	if ( ansi != NULL ) {
+		struct Render *previous = render_use(ansi);
+		bench("draw_buffer_ansi", cells, k_draw_buffer);
+		printf("# draw_buffer_ansi writes %zu bytes per frame\n",
+		       render_last_output(ansi));
+		render_free(ansi);
+		render_use(previous);
+	}
+
+	canvas_free(ctx.canvas);
+	canvas_free(ctx.other);
+	endwin();
+	delscreen(screen);
+	fclose(out);
+	fclose(in);
+}
+
+/* endfold */
+
+int main() {
+	strcpy(ctx.path, "/tmp/ce_bench_XXXXXX");
+	int fd = mkstemp(ctx.path);
+	if ( fd == -1 ) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	palette_default(&ctx.palette);
+	/* No screen yet: the pairs are only counted, not set up */
+	pair_cache_init(COLORS_LEN, PAIRS_MAX - COLORS_LEN);
+
+	printf("# kernel,height,width,cells,iterations,ns_per_cell,mb_per_s\n");
+	foreach (i, 0, (int)(sizeof(SIZES) / sizeof(SIZES[0]))) {
+		bench_canvas(SIZES[i].y, SIZES[i].x);
+	}
+	bench_screen();
+
+	unlink(ctx.path);
+	return 0;
+}